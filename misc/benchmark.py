@@ -0,0 +1,249 @@
+#!/usr/bin/env python3
+import os, sys, argparse, hashlib, json, subprocess, time
+
+from simulator import Simulator
+
+simulator_path = os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), "simulator.py")
+
+# genome length, coverage, mean read length, read length standard deviation
+scales = {
+  "small"  : (  1000000, 20, 10000,  8000),
+  "medium" : (  5000000, 30, 15000, 12000),
+  "large"  : ( 20000000, 40, 20000, 20000),
+  "ultra"  : ( 20000000, 30, 50000, 80000)
+}
+
+class Benchmark:
+  def __init__(self, binary, work_dir, scales, threads, seed):
+    self.binary = binary
+    self.work_dir = work_dir
+    self.scales = scales
+    self.threads = threads
+    self.seed = seed
+
+  def Simulate(self, scale):
+    # data sets are reused only if simulated with the same parameters by the
+    # same simulator, whose source is part of the parameters
+    prefix = os.path.join(self.work_dir, "{}.{}".format(scale, self.seed))
+    genome_len, coverage, mean_len, sd_len = scales[scale]
+    with open(simulator_path, "rb") as f:
+      source = hashlib.sha1(f.read()).hexdigest()
+    params = {
+      "genome_len" : genome_len,
+      "coverage" : coverage,
+      "mean_len" : mean_len,
+      "sd_len" : sd_len,
+      "min_len" : 1000,
+      "error_rate" : 0.05,
+      "chimeric_rate" : 0.02,
+      "seed" : self.seed,
+      "simulator" : source
+    }
+    if os.path.isfile(prefix + ".params.json"):
+      with open(prefix + ".params.json") as f:
+        if json.load(f) == params:
+          return prefix
+      os.remove(prefix + ".params.json")
+
+    simulator = Simulator(prefix, params["genome_len"], params["coverage"],
+        params["mean_len"], params["sd_len"], params["min_len"],
+        params["error_rate"], params["chimeric_rate"], params["seed"])
+    if not simulator.Run():
+      return None
+    # written last, an interrupted run is simulated again
+    with open(prefix + ".params.json", "w") as f:
+      json.dump(params, f, indent = 2, sort_keys = True)
+    return prefix
+
+  def Execute(self, prefix, threads):
+    # returns wall time and peak resident set size of one run
+    output = prefix + ".{}.json".format(threads)
+    with open(output, "w") as f:
+      start = time.time()
+      process = subprocess.Popen(
+          [self.binary, "-a", "-t", str(threads), prefix + ".fasta"],
+          stdout = f, stderr = subprocess.DEVNULL)
+      _, status, usage = os.wait4(process.pid, 0)
+      process.returncode = status
+      elapsed = time.time() - start
+    if status != 0:
+      print("[merlion::Benchmark::Execute] error: {} failed on {}".format(
+          self.binary, prefix))
+      return None
+    return output, elapsed, usage.ru_maxrss * 1024
+
+  def Evaluate(self, prefix, output):
+    # returns data set size and chimera recall and precision
+    truth = {}
+    bases = 0
+    with open(prefix + ".truth.tsv") as f:
+      next(f)
+      for line in f:
+        fields = line.split()
+        truth[int(fields[0])] = fields[1] == "1"
+    with open(prefix + ".fasta") as f:
+      for line in f:
+        if not line.startswith(">"):
+          bases += len(line) - 1
+    with open(output) as f:
+      data = json.load(f)
+
+    tp = fp = fn = 0
+    for key in data:
+      is_chimeric = data[key]["is_chimeric_"]
+      if is_chimeric and truth[int(key)]:
+        tp += 1
+      elif is_chimeric:
+        fp += 1
+      elif truth[int(key)]:
+        fn += 1
+    return {
+      "reads" : len(truth),
+      "chimeric_reads" : sum(truth.values()),
+      "bases" : bases,
+      "recall" : tp / (tp + fn) if tp + fn > 0 else 1.0,
+      "precision" : tp / (tp + fp) if tp + fp > 0 else 1.0
+    }
+
+  def Run(self):
+    if not os.path.isfile(self.binary):
+      print("[merlion::Benchmark::Run] error: missing binary {}".format(
+          self.binary))
+      return None
+    if not os.path.isdir(self.work_dir):
+      os.makedirs(self.work_dir)
+
+    results = {}
+    for scale in self.scales:
+      prefix = self.Simulate(scale)
+      if prefix is None:
+        return None
+      for threads in self.threads:
+        run = self.Execute(prefix, threads)
+        if run is None:
+          return None
+        output, elapsed, rss = run
+        result = self.Evaluate(prefix, output)
+        os.remove(output)
+        result["throughput"] = result["bases"] / elapsed
+        result["peak_rss"] = rss
+
+        key = "{}/{}".format(scale, threads)
+        results[key] = result
+        print("[merlion::Benchmark::Run] {} {:.0f} bp/s {:.1f} MiB "
+              "recall {:.4f} precision {:.4f}".format(key,
+              result["throughput"], rss / 1048576.0, result["recall"],
+              result["precision"]))
+    return results
+
+# machine independent metrics, compared exactly apart from accuracy tolerance
+data_set_metrics = ["reads", "chimeric_reads", "bases"]
+accuracy_metrics = ["recall", "precision"]
+# machine dependent metrics, optional in baseline
+performance_metrics = ["throughput", "peak_rss"]
+
+def Compare(results, baseline, args):
+  # returns a list of violated tolerances and of data set and accuracy
+  # metrics missing from baseline, performance metrics are compared only if
+  # requested and present in baseline
+  dst = []
+  for key in sorted(results):
+    if key not in baseline:
+      dst.append("{} is missing from baseline (record with --update)".format(
+          key))
+      continue
+    r, b = results[key], baseline[key]
+    for metric in data_set_metrics:
+      if metric not in b:
+        dst.append("{} has no {} in baseline (record with --update)".format(
+            key, metric))
+      elif r[metric] != b[metric]:
+        dst.append("{} simulated {} {} != {}".format(
+            key, metric, r[metric], b[metric]))
+    for metric in accuracy_metrics:
+      if metric not in b:
+        dst.append("{} has no {} in baseline (record with --update)".format(
+            key, metric))
+      elif abs(r[metric] - b[metric]) > args.accuracy_tolerance:
+        dst.append("{} {} {:.4f} != {:.4f}".format(
+            key, metric, r[metric], b[metric]))
+    if not args.performance:
+      continue
+    if "throughput" in b and \
+        r["throughput"] < b["throughput"] * (1 - args.throughput_tolerance):
+      dst.append("{} throughput {:.0f} < {:.0f}".format(
+          key, r["throughput"], b["throughput"]))
+    if "peak_rss" in b and \
+        r["peak_rss"] > b["peak_rss"] * (1 + args.rss_tolerance):
+      dst.append("{} peak RSS {} > {}".format(
+          key, r["peak_rss"], b["peak_rss"]))
+  return dst
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(
+      description = "Benchmark runs merlion on simulated reads and compares "
+                    "throughput, peak memory and accuracy to a baseline",
+      formatter_class = argparse.ArgumentDefaultsHelpFormatter)
+  parser.add_argument("binary",
+      help = "path to merlion_preprocess")
+  parser.add_argument("-s", "--scales", nargs = "+", default = ["small"],
+      choices = sorted(scales.keys()),
+      help = "simulated data sets")
+  parser.add_argument("-t", "--threads", nargs = "+", type = int,
+      default = [1, 4],
+      help = "thread counts")
+  parser.add_argument("-b", "--baseline",
+      default = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+          "baseline.json"),
+      help = "baseline in JSON format")
+  parser.add_argument("-u", "--update", action = "store_true",
+      help = "store data set and accuracy metrics into baseline instead of "
+             "comparing")
+  parser.add_argument("-p", "--performance", action = "store_true",
+      help = "compare (or with --update, store) throughput and peak RSS as "
+             "well")
+  parser.add_argument("-w", "--work-dir", default = "benchmark",
+      help = "directory for simulated data sets")
+  parser.add_argument("--seed", type = int, default = 42,
+      help = "seed of simulator")
+  parser.add_argument("--throughput-tolerance", type = float, default = 0.2,
+      help = "allowed relative throughput drop")
+  parser.add_argument("--rss-tolerance", type = float, default = 0.2,
+      help = "allowed relative peak RSS increase")
+  parser.add_argument("--accuracy-tolerance", type = float, default = 0.0,
+      help = "allowed absolute change of recall and precision")
+
+  args = parser.parse_args()
+
+  benchmark = Benchmark(args.binary, args.work_dir, args.scales, args.threads,
+      args.seed)
+  results = benchmark.Run()
+  if results is None:
+    sys.exit(1)
+
+  baseline = {}
+  if os.path.isfile(args.baseline):
+    with open(args.baseline) as f:
+      baseline = json.load(f)
+
+  if args.update:
+    stored = data_set_metrics + accuracy_metrics
+    if args.performance:
+      stored += performance_metrics
+    for key in results:
+      baseline[key] = {m : results[key][m] for m in stored}
+    with open(args.baseline, "w") as f:
+      json.dump(baseline, f, indent = 2, sort_keys = True)
+    print("[merlion::] updated {}".format(args.baseline))
+    sys.exit(0)
+
+  if not baseline:
+    print("[merlion::] error: missing baseline {} (run with --update)".format(
+        args.baseline))
+    sys.exit(1)
+
+  violations = Compare(results, baseline, args)
+  for it in violations:
+    print("[merlion::Compare] error: {}".format(it))
+  sys.exit(1 if violations else 0)
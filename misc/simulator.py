@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+import sys, argparse, math, random
+
+class Simulator:
+  def __init__(self, prefix, genome_len, coverage, mean_len, sd_len, min_len,
+      error_rate, chimeric_rate, seed):
+    self.prefix = prefix
+    self.genome_len = genome_len
+    self.coverage = coverage
+    self.mean_len = mean_len
+    self.sd_len = sd_len
+    self.min_len = min_len
+    self.error_rate = error_rate
+    self.chimeric_rate = chimeric_rate
+    self.rng = random.Random(seed)
+    self.complement = {"A" : "T", "C" : "G", "G" : "C", "T" : "A"}
+
+  def DrawLength(self):
+    # lognormal with given mean and standard deviation
+    sigma = math.sqrt(math.log(1 + (self.sd_len / self.mean_len) ** 2))
+    mu = math.log(self.mean_len) - sigma ** 2 / 2
+    while True:
+      l = int(self.rng.lognormvariate(mu, sigma))
+      if self.min_len <= l <= self.genome_len:
+        return l
+
+  def DrawFragment(self, genome, l):
+    begin = self.rng.randrange(0, len(genome) - l + 1)
+    fragment = genome[begin : begin + l]
+    if self.rng.random() < 0.5:
+      fragment = "".join(self.complement[c] for c in reversed(fragment))
+    return fragment
+
+  def AddErrors(self, read):
+    if self.error_rate <= 0:
+      return read
+    # jump from error to error instead of rolling a die for each base
+    dst = []
+    last = 0
+    i = int(self.rng.expovariate(self.error_rate))
+    while i < len(read):
+      dst.append(read[last : i])
+      error = self.rng.randrange(3)
+      if error == 0:  # substitution
+        dst.append(self.rng.choice("ACGT".replace(read[i], "")))
+        last = i + 1
+      elif error == 1:  # insertion
+        dst.append(self.rng.choice("ACGT"))
+        last = i
+      else:  # deletion
+        last = i + 1
+      i += 1 + int(self.rng.expovariate(self.error_rate))
+    dst.append(read[last:])
+    return "".join(dst)
+
+  def Run(self):
+    if self.genome_len < self.min_len:
+      print("[merlion::Simulator::Run] error: genome is shorter than reads")
+      return False
+
+    genome = "".join(self.rng.choice("ACGT") for i in range(self.genome_len))
+
+    try:
+      reads = open(self.prefix + ".fasta", "w")
+      truth = open(self.prefix + ".truth.tsv", "w")
+    except Exception:
+      print("[merlion::Simulator::Run] error: unable to create {}.*".format(
+          self.prefix))
+      return False
+
+    truth.write("id\tis_chimeric\tjunction\n")
+
+    i = 0
+    bases = 0
+    while bases < self.genome_len * self.coverage:
+      l = self.DrawLength()
+      if self.rng.random() < self.chimeric_rate:
+        junction = self.rng.randrange(l // 4, l - l // 4)
+        read = self.DrawFragment(genome, junction) + \
+               self.DrawFragment(genome, l - junction)
+      else:
+        junction = 0
+        read = self.DrawFragment(genome, l)
+      read = self.AddErrors(read)
+
+      reads.write(">read{} chimeric={}\n{}\n".format(
+          i, int(junction > 0), read))
+      truth.write("{}\t{}\t{}\n".format(i, int(junction > 0), junction))
+
+      i += 1
+      bases += len(read)
+
+    reads.close()
+    truth.close()
+    return True
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(
+      description = "Simulator is a tool for generating reads with known "
+                    "chimeric joins",
+      formatter_class = argparse.ArgumentDefaultsHelpFormatter)
+  parser.add_argument("prefix",
+      help = "output prefix of reads (.fasta) and truth (.truth.tsv)")
+  parser.add_argument("-g", "--genome-len", type = int, default = 1000000,
+      help = "length of random reference genome")
+  parser.add_argument("-c", "--coverage", type = float, default = 30,
+      help = "sequencing depth")
+  parser.add_argument("-m", "--mean-len", type = float, default = 10000,
+      help = "mean of lognormal read length distribution")
+  parser.add_argument("-d", "--sd-len", type = float, default = 8000,
+      help = "standard deviation of lognormal read length distribution")
+  parser.add_argument("-l", "--min-len", type = int, default = 1000,
+      help = "minimal read length")
+  parser.add_argument("-e", "--error-rate", type = float, default = 0.05,
+      help = "per base probability of substitution, insertion or deletion")
+  parser.add_argument("-r", "--chimeric-rate", type = float, default = 0.02,
+      help = "fraction of reads joined from two random fragments")
+  parser.add_argument("-s", "--seed", type = int, default = 42,
+      help = "seed of random number generator")
+
+  args = parser.parse_args()
+
+  simulator = Simulator(args.prefix, args.genome_len, args.coverage,
+      args.mean_len, args.sd_len, args.min_len, args.error_rate,
+      args.chimeric_rate, args.seed)
+  if not simulator.Run():
+    sys.exit(1)
@@ -2,7 +2,13 @@
 
 #include <getopt.h>
 
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <sstream>
 #include <stdexcept>
 
 #include "bioparser/fasta_parser.hpp"
@@ -11,6 +17,7 @@
 #include "cereal/archives/json.hpp"
 #include "ram/minimizer_engine.hpp"
 
+#include "numa.hpp"
 #include "pile.hpp"
 #include "stack.hpp"
 
@@ -24,6 +31,8 @@ static struct option options[] = {
   {"window-len", required_argument, nullptr, 'w'},
   {"frequency", required_argument, nullptr, 'f'},
   {"threads", required_argument, nullptr, 't'},
+  {"sweep", required_argument, nullptr, 's'},
+  {"numa", no_argument, nullptr, 'n'},
   {"version", no_argument, nullptr, 'v'},
   {"help", no_argument, nullptr, 'h'},
   {nullptr, 0, nullptr, 0}
@@ -62,6 +71,134 @@ std::unique_ptr<bioparser::Parser<biosoup::NucleicAcid>> CreateParser(
   return nullptr;
 }
 
+// indices sorted by decreasing cost, equal costs keep their order
+std::vector<std::uint32_t> LongestFirst(
+    const std::vector<std::uint64_t>& costs) {
+  std::vector<std::uint32_t> dst(costs.size());
+  for (std::uint32_t i = 0; i < dst.size(); ++i) {
+    dst[i] = i;
+  }
+  std::stable_sort(dst.begin(), dst.end(),
+      [&] (std::uint32_t lhs, std::uint32_t rhs) -> bool {
+        return costs[lhs] > costs[rhs];
+      });
+  return dst;
+}
+
+// tail latency of a phase, time from the start of its last task (or the end
+// of its first one, if later) to the end of its last task
+class Tail {
+ public:
+  Tail() {
+    Reset();
+  }
+
+  void Reset() {
+    last_begin_ = 0;
+    first_end_ = std::numeric_limits<std::int64_t>::max();
+    last_end_ = 0;
+  }
+
+  void Begin() {
+    Update(&last_begin_, Now(), true);
+  }
+
+  void End() {
+    auto now = Now();
+    Update(&first_end_, now, false);
+    Update(&last_end_, now, true);
+  }
+
+  double Seconds() const {
+    auto begin = std::max(last_begin_.load(), first_end_.load());
+    return last_end_ > begin ? (last_end_ - begin) / 1e9 : 0;
+  }
+
+ private:
+  static void Update(std::atomic<std::int64_t>* t, std::int64_t v, bool max) {
+    auto it = t->load();
+    while ((max ? it < v : it > v) && !t->compare_exchange_weak(it, v)) {
+    }
+  }
+
+  static std::int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  std::atomic<std::int64_t> last_begin_;
+  std::atomic<std::int64_t> first_end_;
+  std::atomic<std::int64_t> last_end_;
+};
+
+std::vector<merlion::Pile::Setting> ParseGrid(const std::string& grid) {
+  auto split = [] (const std::string& s, char delim) -> std::vector<std::string> {  // NOLINT
+    std::vector<std::string> dst;
+    std::istringstream ss(s);
+    std::string token;
+    while (std::getline(ss, token, delim)) {
+      dst.emplace_back(token);
+    }
+    if (!s.empty() && s.back() == delim) {  // keep trailing empty token
+      dst.emplace_back();
+    }
+    return dst;
+  };
+
+  // values of a comma separated list, empty if any is malformed or out of
+  // range, ratios are positive and integers lie in [min, max]
+  auto parse_ratios = [&] (const std::string& s) -> std::vector<double> {
+    std::vector<double> dst;
+    for (const auto& it : split(s, ',')) {
+      char* end = nullptr;
+      double v = std::strtod(it.c_str(), &end);
+      if (it.empty() || *end != '\0' ||
+          !(0 < v && v <= std::numeric_limits<double>::max())) {
+        return decltype(dst)();
+      }
+      dst.emplace_back(v);
+    }
+    return dst;
+  };
+  auto parse_integers = [&] (const std::string& s, long min, long max) -> std::vector<long> {  // NOLINT
+    std::vector<long> dst;  // NOLINT
+    for (const auto& it : split(s, ',')) {
+      char* end = nullptr;
+      errno = 0;
+      long v = std::strtol(it.c_str(), &end, 10);  // NOLINT
+      if (it.empty() || *end != '\0' || errno != 0 || v < min || v > max) {
+        return decltype(dst)();
+      }
+      dst.emplace_back(v);
+    }
+    return dst;
+  };
+
+  std::vector<merlion::Pile::Setting> dst;
+
+  auto axes = split(grid, ':');
+  if (axes.size() != 3) {
+    return dst;
+  }
+  auto ratios = parse_ratios(axes[0]);
+  auto windows = parse_integers(
+      axes[1], 1, std::numeric_limits<std::int32_t>::max());
+  auto min_medians = parse_integers(
+      axes[2], 0, std::numeric_limits<std::uint16_t>::max());
+
+  for (const auto& r : ratios) {
+    for (const auto& w : windows) {
+      for (const auto& m : min_medians) {
+        dst.emplace_back(merlion::Pile::Setting{
+            r,
+            static_cast<std::uint32_t>(w),
+            static_cast<std::uint16_t>(m)});
+      }
+    }
+  }
+  return dst;
+}
+
 void Help() {
   std::cout <<
       "usage: merlion [options ...] <sequences> [<sequences> ...]\n"
@@ -85,6 +222,15 @@ void Help() {
       "    -t, --threads <int>\n"
       "      default: 1\n"
       "      number of threads\n"
+      "    --sweep <ratios>:<windows>:<min-medians>\n"
+      "      e.g. 1.5,1.82,2:512,847:3,4\n"
+      "      annotate with every combination of comma separated values of\n"
+      "      coverage ratio, slope window length and minimal median coverage\n"
+      "      (default setting is 1.82:847:4), outputs a tab separated table\n"
+      "      of per sequence verdicts instead of JSON\n"
+      "    --numa\n"
+      "      pin threads to NUMA nodes and let each thread allocate and\n"
+      "      update its own share of sequences\n"
       "    --version\n"
       "      prints the version number\n"
       "    -h, --help\n"
@@ -102,6 +248,10 @@ int main(int argc, char** argv) {
 
   std::uint32_t num_threads = 1;
 
+  std::vector<merlion::Pile::Setting> settings;
+
+  bool affinity = false;
+
   std::string optstr = "ak:w:f:t:h";
   int arg;
   while ((arg = getopt_long(argc, argv, optstr.c_str(), options, nullptr)) != -1) {  // NOLINT
@@ -111,6 +261,17 @@ int main(int argc, char** argv) {
       case 'w': window_len = std::atoi(optarg); break;
       case 'f': freq = std::atof(optarg); break;
       case 't': num_threads = std::atoi(optarg); break;
+      case 's': {
+        settings = ParseGrid(optarg);
+        if (settings.empty()) {
+          std::cerr << "[merlion::] error: invalid sweep grid " << optarg
+                    << std::endl;
+          return 1;
+        }
+        annotate = true;
+        break;
+      }
+      case 'n': affinity = true; break;
       case 'v': std::cout << VERSION << std::endl; return 0;
       case 'h': Help(); return 0;
       default: return 1;
@@ -127,6 +288,20 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  merlion::Numa numa{};
+  if (affinity) {
+    if (numa.num_nodes() == 0) {
+      std::cerr << "[merlion::] warning: NUMA topology is not available"
+                << std::endl;
+      affinity = false;
+    } else if (numa.num_nodes() > 1 && !numa.Interleave()) {
+      // sequences and minimizers are shared by all nodes
+      std::cerr << "[merlion::] warning: unable to interleave memory "
+                << "(set_mempolicy failed)"
+                << std::endl;
+    }
+  }
+
   biosoup::Timer timer{};
   timer.Start();
 
@@ -174,6 +349,74 @@ int main(int argc, char** argv) {
   auto thread_pool = std::make_shared<thread_pool::ThreadPool>(num_threads);
   ram::MinimizerEngine minimizer_engine{thread_pool, kmer_len, window_len};
 
+  // in affinity mode worker i allocates and updates stacks
+  // [owned[i], owned[i + 1]), shares are balanced by sequence length
+  std::vector<std::uint32_t> owned(
+      thread_pool->num_threads() + 1,
+      stacks.size());
+  owned[0] = 0;
+  {
+    std::uint64_t total_len = 0;
+    for (const auto& it : stacks) {
+      total_len += it.len();
+    }
+    std::uint64_t len = 0;
+    for (std::uint32_t i = 0, w = 1; i < stacks.size(); ++i) {
+      for (; w < thread_pool->num_threads() &&
+             len >= total_len * w / thread_pool->num_threads(); ++w) {
+        owned[w] = i;
+      }
+      len += stacks[i].len();
+    }
+  }
+  if (affinity) {
+    std::atomic<std::uint32_t> num_failed{0};
+    merlion::ForEachWorker(thread_pool, [&] (std::uint32_t i) -> void {
+      if (!numa.Pin(numa.Node(i, thread_pool->num_threads()))) {
+        ++num_failed;
+      }
+    });
+
+    if (num_failed > 0) {
+      std::cerr << "[merlion::] warning: unable to pin " << num_failed
+                << " / " << thread_pool->num_threads() << " threads "
+                << "(sched_setaffinity or set_mempolicy failed)"
+                << std::endl;
+    }
+    std::cerr << "[merlion::] pinned "
+              << thread_pool->num_threads() - num_failed
+              << " threads to " << numa.num_nodes() << " NUMA node(s)"
+              << std::endl;
+  }
+
+  // add pages of [data, data + size) on the node of worker w to local and
+  // pages on other nodes to remote
+  auto count_pages = [&] (
+      std::uint32_t w,
+      const void* data,
+      std::size_t size,
+      std::uint64_t* local,
+      std::uint64_t* remote) -> void {
+    int node = numa.id(numa.Node(w, thread_pool->num_threads()));
+    for (const auto& it : merlion::Numa::FindNodes(data, size)) {
+      if (it == node) {
+        ++*local;
+      } else if (it != -1) {
+        ++*remote;
+      }
+    }
+  };
+
+  // long sequences are mapped first so that short ones fill the tail
+  std::vector<std::uint32_t> map_order;
+  {
+    std::vector<std::uint64_t> costs;
+    for (const auto& it : sequences) {
+      costs.emplace_back(it->inflated_len);
+    }
+    map_order = LongestFirst(costs);
+  }
+
   for (std::size_t i = 0, j = 0, bytes = 0; i < sequences.size(); ++i) {
     bytes += sequences[i]->inflated_len;
     if (i != sequences.size() - 1 && bytes < (1ULL << 32)) {
@@ -196,57 +439,283 @@ int main(int argc, char** argv) {
 
     timer.Start();
 
+    Tail tail{};
+    double map_tail = 0;
+
     std::vector<std::future<std::vector<biosoup::Overlap>>> futures;
-    for (std::uint32_t k = 0; k < i + 1; ++k) {
+    for (std::size_t m = 0, n = 0; m < map_order.size(); ++m) {
+      std::uint32_t k = map_order[m];
+      if (k > i) {
+        continue;
+      }
       futures.emplace_back(thread_pool->Submit(
           [&] (std::uint32_t i) -> std::vector<biosoup::Overlap> {
-            return minimizer_engine.Map(sequences[i], true, true, true);
+            tail.Begin();
+            auto dst = minimizer_engine.Map(sequences[i], true, true, true);
+            if (affinity) {
+              std::sort(dst.begin(), dst.end(),
+                  [] (const biosoup::Overlap& lhs,
+                      const biosoup::Overlap& rhs) -> bool {
+                    return lhs.rhs_id < rhs.rhs_id;
+                  });
+            }
+            tail.End();
+            return dst;
           },
           k));
       bytes += sequences[k]->inflated_len;
-      if (k != i && bytes < (1U << 30)) {
+      if (++n != i + 1 && bytes < (1U << 30)) {
         continue;
       }
       bytes = 0;
 
-      for (auto& it : futures) {
-        for (const auto& jt : it.get()) {
-          stacks[jt.lhs_id].AddLayer(jt);
-          stacks[jt.rhs_id].AddLayer(jt);
+      if (!affinity) {
+        for (auto& it : futures) {
+          for (const auto& jt : it.get()) {
+            stacks[jt.lhs_id].AddLayer(jt);
+            stacks[jt.rhs_id].AddLayer(jt);
+          }
         }
+        futures.clear();
+
+        tail.End();  // drain is part of the tail
+        map_tail += tail.Seconds();
+        tail.Reset();
+        continue;
+      }
+
+      std::vector<std::vector<biosoup::Overlap>> overlaps;
+      for (auto& it : futures) {
+        overlaps.emplace_back(it.get());
       }
       futures.clear();
+
+      // overlaps of a query share its id as lhs and are sorted by rhs
+      merlion::ForEachWorker(thread_pool, [&] (std::uint32_t w) -> void {
+        std::uint32_t begin = owned[w], end = owned[w + 1];
+        auto rhs_less = [] (const biosoup::Overlap& o, std::uint32_t id) -> bool {  // NOLINT
+          return o.rhs_id < id;
+        };
+        for (const auto& it : overlaps) {
+          if (it.empty()) {
+            continue;
+          }
+          if (begin <= it.front().lhs_id && it.front().lhs_id < end) {
+            stacks[it.front().lhs_id].AddLayers(it.begin(), it.end());
+          }
+          auto jt = std::lower_bound(it.begin(), it.end(), begin, rhs_less);
+          auto kt = std::lower_bound(jt, it.end(), end, rhs_less);
+          for (; jt != kt; ++jt) {
+            stacks[jt->rhs_id].AddLayer(*jt);
+          }
+        }
+      });
+
+      tail.End();  // drain is part of the tail
+      map_tail += tail.Seconds();
+      tail.Reset();
     }
 
     std::cerr << "[merlion::] mapped sequences "
               << std::fixed << timer.Stop() << "s"
+              << " (tail " << map_tail << "s)"
               << std::endl;
 
     j = i + 1;
   }
-  for (auto& it : stacks) {
-    it.SortLayers();
+
+  timer.Start();
+
+  // batches of contiguous stacks with similar number of layers, in affinity
+  // mode batches do not cross ownership ranges and are taken by any worker
+  // on the node of the owner
+  std::uint64_t num_layers = 0;
+  for (const auto& it : stacks) {
+    num_layers += it.layers().size();
+  }
+  std::uint64_t batch_size = num_layers / (4 * thread_pool->num_threads()) + 1;  // NOLINT
+
+  std::vector<std::uint32_t> batches{0};  // boundaries
+  std::vector<std::uint32_t> batch_nodes;
+  auto split = [&] (std::uint32_t begin, std::uint32_t end, std::uint32_t node) -> void {  // NOLINT
+    for (std::uint64_t i = begin, n = 0; i < end; ++i) {
+      n += stacks[i].layers().size();
+      if (i != end - 1 && n < batch_size) {
+        continue;
+      }
+      batches.emplace_back(i + 1);
+      batch_nodes.emplace_back(node);
+      n = 0;
+    }
+  };
+  if (affinity) {
+    for (std::uint32_t w = 0; w < thread_pool->num_threads(); ++w) {
+      split(owned[w], owned[w + 1], numa.Node(w, thread_pool->num_threads()));
+    }
+  } else {
+    split(0, stacks.size(), 0);
   }
 
-  if (annotate) {
-    timer.Start();
+  auto sort_batch = [&] (std::uint32_t b) -> void {
+    for (std::uint32_t i = batches[b]; i < batches[b + 1]; ++i) {
+      stacks[i].SortLayers();
+    }
+  };
 
-    std::vector<std::unique_ptr<merlion::Pile>> piles;
-    for (const auto& it : stacks) {
-      piles.emplace_back(std::unique_ptr<merlion::Pile>(new merlion::Pile(it)));
+  Tail tail{};
+  if (affinity) {
+    // batches of a node are contiguous
+    std::vector<std::atomic<std::uint32_t>> next_batch(numa.num_nodes());
+    std::vector<std::uint32_t> last_batch(numa.num_nodes(), 0);
+    for (auto& it : next_batch) {
+      it = 0;
+    }
+    for (std::uint32_t i = 0; i < batch_nodes.size(); ++i) {
+      if (last_batch[batch_nodes[i]] == 0) {
+        next_batch[batch_nodes[i]] = i;
+      }
+      last_batch[batch_nodes[i]] = i + 1;
     }
 
+    merlion::ForEachWorker(thread_pool, [&] (std::uint32_t w) -> void {
+      tail.Begin();
+      auto node = numa.Node(w, thread_pool->num_threads());
+      for (std::uint32_t b = next_batch[node]++; b < last_batch[node];
+           b = next_batch[node]++) {
+        sort_batch(b);
+      }
+      tail.End();
+    });
+  } else {
     std::vector<std::future<void>> futures;
-    for (const auto& it : piles) {
+    for (std::uint32_t i = 0; i < batch_nodes.size(); ++i) {
       futures.emplace_back(thread_pool->Submit(
-          [] (merlion::Pile* it) -> void {
-            it->FindMedian();
+          [&] (std::uint32_t b) -> void {
+            tail.Begin();
+            sort_batch(b);
+            tail.End();
           },
-          it.get()));
+          i));
     }
     for (const auto& it : futures) {
       it.wait();
     }
+  }
+
+  std::cerr << "[merlion::] sorted layers "
+            << std::fixed << timer.Stop() << "s"
+            << " (tail " << tail.Seconds() << "s)"
+            << std::endl;
+
+  if (affinity) {
+    std::atomic<std::uint64_t> num_local{0}, num_remote{0};
+    merlion::ForEachWorker(thread_pool, [&] (std::uint32_t w) -> void {
+      std::uint64_t local = 0, remote = 0;
+      for (std::uint32_t i = owned[w]; i < owned[w + 1]; ++i) {
+        const auto& it = stacks[i].layers();
+        count_pages(
+            w,
+            it.data(),
+            it.size() * sizeof(it.front()),
+            &local,
+            &remote);
+      }
+      num_local += local;
+      num_remote += remote;
+    });
+
+    std::cerr << "[merlion::] NUMA layer pages local " << num_local
+              << ", remote " << num_remote
+              << std::endl;
+  }
+
+  if (annotate) {
+    timer.Start();
+
+    // run f on each pile in the given order and return the tail latency,
+    // in affinity mode each worker runs the piles it owns in that order
+    auto for_each_pile = [&] (
+        const std::vector<std::uint32_t>& order,
+        const std::function<void(std::uint32_t)>& f) -> double {
+      tail.Reset();
+      if (affinity) {
+        std::vector<std::vector<std::uint32_t>> worker_orders(
+            thread_pool->num_threads());
+        for (const auto& it : order) {
+          auto w = std::upper_bound(owned.begin(), owned.end(), it) -
+              owned.begin() - 1;
+          worker_orders[w].emplace_back(it);
+        }
+        merlion::ForEachWorker(thread_pool, [&] (std::uint32_t w) -> void {
+          tail.Begin();
+          for (const auto& it : worker_orders[w]) {
+            f(it);
+          }
+          tail.End();
+        });
+        return tail.Seconds();
+      }
+      std::vector<std::future<void>> futures;
+      for (const auto& it : order) {
+        futures.emplace_back(thread_pool->Submit(
+            [&] (std::uint32_t i) -> void {
+              tail.Begin();
+              f(i);
+              tail.End();
+            },
+            it));
+      }
+      for (const auto& it : futures) {
+        it.wait();
+      }
+      return tail.Seconds();
+    };
+
+    // piles are built from layers and scanned along sequences
+    std::vector<std::uint32_t> build_order, scan_order;
+    {
+      std::vector<std::uint64_t> costs;
+      for (const auto& it : stacks) {
+        costs.emplace_back(it.layers().size());
+      }
+      build_order = LongestFirst(costs);
+
+      costs.clear();
+      for (const auto& it : stacks) {
+        costs.emplace_back(it.len());
+      }
+      scan_order = LongestFirst(costs);
+    }
+
+    std::vector<std::unique_ptr<merlion::Pile>> piles(stacks.size());
+    double build_tail = for_each_pile(
+        build_order,
+        [&] (std::uint32_t i) -> void {
+          piles[i].reset(new merlion::Pile(stacks[i]));
+          piles[i]->FindMedian();
+        });
+
+    if (affinity) {
+      std::atomic<std::uint64_t> num_local{0}, num_remote{0};
+      merlion::ForEachWorker(thread_pool, [&] (std::uint32_t w) -> void {
+        std::uint64_t local = 0, remote = 0;
+        for (std::uint32_t i = owned[w]; i < owned[w + 1]; ++i) {
+          const auto& it = piles[i]->data();
+          count_pages(
+              w,
+              it.data(),
+              it.size() * sizeof(it.front()),
+              &local,
+              &remote);
+        }
+        num_local += local;
+        num_remote += remote;
+      });
+
+      std::cerr << "[merlion::] NUMA pile pages local " << num_local
+                << ", remote " << num_remote
+                << std::endl;
+    }
 
     std::vector<std::uint16_t> coverage;
     for (const auto& it : piles) {
@@ -258,18 +727,57 @@ int main(int argc, char** argv) {
         coverage.end());
     auto median_coverage = coverage[coverage.size() / 2];
 
-    futures.clear();
-    for (const auto& it : piles) {
-      futures.emplace_back(thread_pool->Submit(
-          [&] (merlion::Pile* it) -> void {
-            it->FindChimericRegions(median_coverage);
-          },
-          it.get()));
-    }
-    for (const auto& it : futures) {
-      it.wait();
+    if (!settings.empty()) {
+      std::vector<std::vector<bool>> verdicts(piles.size());
+      double sweep_tail = for_each_pile(
+          scan_order,
+          [&] (std::uint32_t i) -> void {
+            verdicts[i] = piles[i]->Sweep(median_coverage, settings);
+          });
+
+      std::cerr << "[merlion::] swept " << settings.size() << " settings "
+                << std::fixed << timer.Stop() << "s"
+                << " (tail " << build_tail << "s, " << sweep_tail << "s)"
+                << std::endl;
+
+      std::cout << "id";
+      for (std::uint32_t i = 0; i < settings.size(); ++i) {
+        std::ostringstream label;
+        label << settings[i].ratio << ":"
+              << settings[i].window << ":"
+              << settings[i].min_median;
+
+        std::uint32_t num_chimeric = 0;
+        for (const auto& it : verdicts) {
+          num_chimeric += it[i];
+        }
+        std::cerr << "[merlion::] sweep " << label.str() << " "
+                  << num_chimeric << " chimeric"
+                  << std::endl;
+
+        std::cout << "\t" << label.str();
+      }
+      std::cout << "\n";
+      for (std::uint32_t i = 0; i < piles.size(); ++i) {
+        std::cout << piles[i]->id();
+        for (const auto& it : verdicts[i]) {
+          std::cout << "\t" << it;
+        }
+        std::cout << "\n";
+      }
+
+      std::cerr << "[merlion::] " << std::fixed << timer.elapsed_time() << "s"
+                << std::endl;
+
+      return 0;
     }
 
+    double annotate_tail = for_each_pile(
+        scan_order,
+        [&] (std::uint32_t i) -> void {
+          piles[i]->FindChimericRegions(median_coverage);
+        });
+
     for (const auto& it : piles) {
       if (it->is_chimeric()) {
         stacks[it->id()].set_is_chimeric();
@@ -278,6 +786,7 @@ int main(int argc, char** argv) {
 
     std::cerr << "[merlion::] annotated sequences "
               << std::fixed << timer.Stop() << "s"
+              << " (tail " << build_tail << "s, " << annotate_tail << "s)"
               << std::endl;
   }
 
@@ -0,0 +1,194 @@
+// Copyright (c) 2021 Robert Vaser
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "numa.hpp"
+
+namespace merlion {
+
+constexpr int kMpolDefault = 0;  // linux/mempolicy.h
+constexpr int kMpolInterleave = 3;
+
+std::vector<std::uint32_t> ParseCpuList(const std::string& s) {
+  std::vector<std::uint32_t> dst;
+  std::istringstream ss(s);
+  std::string token;
+  while (std::getline(ss, token, ',')) {
+    if (token.empty()) {
+      continue;
+    }
+    auto dash = token.find('-');
+    std::uint32_t first = std::atoi(token.c_str());
+    std::uint32_t last = dash == std::string::npos ?
+        first : std::atoi(token.c_str() + dash + 1);
+    for (std::uint32_t i = first; i <= last; ++i) {
+      dst.emplace_back(i);
+    }
+  }
+  return dst;
+}
+
+Numa::Numa()
+    : ids_(),
+      cpus_() {
+  std::string root = "/sys/devices/system/node";
+  DIR* dir = opendir(root.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+
+  std::vector<std::uint32_t> ids;
+  while (dirent* it = readdir(dir)) {
+    std::string name = it->d_name;
+    if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+        std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+      ids.emplace_back(std::atoi(name.c_str() + 4));
+    }
+  }
+  closedir(dir);
+  std::sort(ids.begin(), ids.end());
+
+  for (const auto& it : ids) {
+    std::ifstream f(root + "/node" + std::to_string(it) + "/cpulist");
+    std::string line;
+    std::getline(f, line);
+    auto cpus = ParseCpuList(line);
+    if (!cpus.empty()) {  // skip memory only nodes
+      ids_.emplace_back(it);
+      cpus_.emplace_back(cpus);
+    }
+  }
+}
+
+std::uint32_t Numa::Node(std::uint32_t i, std::uint32_t n) const {
+  if (ids_.empty() || n == 0) {
+    return 0;
+  }
+  return static_cast<std::uint64_t>(i) * ids_.size() / n;
+}
+
+bool Numa::Pin(std::uint32_t node) const {
+  if (node >= cpus_.size()) {
+    return false;
+  }
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const auto& it : cpus_[node]) {
+    CPU_SET(it, &set);
+  }
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    return false;
+  }
+#else
+  return false;
+#endif
+#ifdef SYS_set_mempolicy
+  // threads inherit the policy of their creator, allocate on the local node
+  return syscall(SYS_set_mempolicy, kMpolDefault, nullptr, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+bool Numa::Interleave() const {
+  if (ids_.size() < 2) {
+    return false;
+  }
+#ifdef SYS_set_mempolicy
+  constexpr std::uint32_t kBits = 8 * sizeof(unsigned long);  // NOLINT
+  std::vector<unsigned long> mask(ids_.back() / kBits + 1, 0);  // NOLINT
+  for (const auto& it : ids_) {
+    mask[it / kBits] |= 1UL << (it % kBits);
+  }
+  return syscall(
+      SYS_set_mempolicy,
+      kMpolInterleave,
+      mask.data(),
+      mask.size() * kBits + 1) == 0;
+#else
+  return false;
+#endif
+}
+
+std::vector<int> Numa::FindNodes(const void* address, std::size_t size) {
+  std::vector<int> dst;
+  if (size == 0) {
+    return dst;
+  }
+  std::uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(address);
+  std::uintptr_t end = begin + size;
+  begin -= begin % page_size;
+
+  std::vector<void*> pages;
+  for (std::uintptr_t it = begin; it < end; it += page_size) {
+    pages.emplace_back(reinterpret_cast<void*>(it));
+  }
+  dst.resize(pages.size(), -1);
+#ifdef SYS_move_pages
+  // without target nodes the status of each page is its node
+  if (syscall(
+      SYS_move_pages,
+      0,
+      pages.size(),
+      pages.data(),
+      nullptr,
+      dst.data(),
+      0) != 0) {
+    std::fill(dst.begin(), dst.end(), -1);
+  }
+  for (auto& it : dst) {
+    if (it < 0) {  // -errno
+      it = -1;
+    }
+  }
+#endif
+  return dst;
+}
+
+void ForEachWorker(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+    const std::function<void(std::uint32_t)>& f) {
+  std::uint32_t n = thread_pool->num_threads();
+
+  // no task proceeds before all have started, hence each holds its own
+  // thread, which is identified by its fixed index in the thread pool
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::uint32_t num_started = 0;
+
+  std::vector<std::future<void>> futures;
+  for (std::uint32_t i = 0; i < n; ++i) {
+    futures.emplace_back(thread_pool->Submit(
+        [&] () -> void {
+          {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (++num_started == n) {
+              cv.notify_all();
+            } else {
+              cv.wait(lock, [&] () -> bool { return num_started == n; });
+            }
+          }
+          f(thread_pool->thread_ids().at(std::this_thread::get_id()));
+        }));
+  }
+  for (const auto& it : futures) {
+    it.wait();
+  }
+}
+
+}  // namespace merlion
@@ -0,0 +1,64 @@
+// Copyright (c) 2021 Robert Vaser
+
+#ifndef MERLION_NUMA_HPP_
+#define MERLION_NUMA_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "thread_pool/thread_pool.hpp"
+
+namespace merlion {
+
+// NUMA nodes with at least one cpu, read from sysfs
+class Numa {
+ public:
+  Numa();
+
+  Numa(const Numa&) = default;
+  Numa& operator=(const Numa&) = default;
+
+  Numa(Numa&&) = default;
+  Numa& operator=(Numa&&) = default;
+
+  ~Numa() = default;
+
+  std::uint32_t num_nodes() const {
+    return ids_.size();
+  }
+
+  // system id of node
+  std::uint32_t id(std::uint32_t node) const {
+    return ids_[node];
+  }
+
+  // node of worker i out of n, workers are spread in contiguous blocks
+  std::uint32_t Node(std::uint32_t i, std::uint32_t n) const;
+
+  // restrict calling thread to cpus of node and allocate on it
+  bool Pin(std::uint32_t node) const;
+
+  // spread pages later touched by calling thread over all nodes
+  bool Interleave() const;
+
+  // system ids of nodes holding the pages of [address, address + size), -1
+  // for pages that are unknown or not touched yet
+  static std::vector<int> FindNodes(const void* address, std::size_t size);
+
+ private:
+  std::vector<std::uint32_t> ids_;
+  std::vector<std::vector<std::uint32_t>> cpus_;
+};
+
+// run f(i) once on each worker of an idle thread pool, i is the index of the
+// worker in the thread pool and is the same across calls
+void ForEachWorker(
+    std::shared_ptr<thread_pool::ThreadPool> thread_pool,
+    const std::function<void(std::uint32_t)>& f);
+
+}  // namespace merlion
+
+#endif  // MERLION_NUMA_HPP_
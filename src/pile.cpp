@@ -10,17 +10,44 @@ namespace merlion {
 
 constexpr std::uint32_t kPSS = 4;  // shrink 2 ^ kPSS times
 
+constexpr std::uint32_t kCPS = 4;  // coarse pile shrinks 2 ^ kCPS times more
+
 constexpr double kCQ = 1.82;
 
+constexpr std::uint32_t kSWL = 847;  // slope window length
+
+constexpr std::uint16_t kMMC = 4;  // minimal median coverage
+
 template<typename T>
 T Clamp(T v) {
   return v < std::numeric_limits<std::uint16_t>::max() ?
          v : std::numeric_limits<std::uint16_t>::max();
 }
 
+using Subpile = std::deque<std::pair<std::int32_t, std::uint16_t>>;
+
+void SubpileAdd(Subpile& s, std::uint16_t value, std::int32_t position) {
+  while (!s.empty() && s.back().second <= value) {
+    s.pop_back();
+  }
+  s.emplace_back(position, value);
+}
+
+void SubpileUpdate(Subpile& s, std::int32_t position) {
+  while (!s.empty() && s.front().first <= position) {
+    s.pop_front();
+  }
+}
+
+std::int32_t WindowLength(std::uint32_t window) {
+  return std::max(static_cast<std::int32_t>(window >> kPSS), 1);
+}
+
 Pile::Pile(const Stack& s)
     : id_(s.id()),
       data_(s.len() >> kPSS),
+      coarse_min_(),
+      coarse_max_(),
       median_(0),
       is_chimeric_(false),
       chimeric_regions_() {
@@ -42,6 +69,19 @@ Pile::Pile(const Stack& s)
     last_boundary = it >> 1;
     coverage += it & 1 ? -1 : 1;
   }
+
+  // end points never belong to a chimeric region
+  std::uint32_t num_bins = (data_.size() + (1U << kCPS) - 1) >> kCPS;
+  coarse_min_.resize(num_bins, std::numeric_limits<std::uint16_t>::max());
+  coarse_max_.resize(num_bins, 0);
+  for (std::uint32_t i = 0; i < data_.size(); ++i) {
+    auto& max = coarse_max_[i >> kCPS];
+    max = std::max(max, data_[i]);
+    if (i != 0 && i != data_.size() - 1) {
+      auto& min = coarse_min_[i >> kCPS];
+      min = std::min(min, data_[i]);
+    }
+  }
 }
 
 void Pile::FindMedian() {
@@ -51,64 +91,218 @@ void Pile::FindMedian() {
 }
 
 void Pile::FindChimericRegions(std::uint16_t median) {
-  if (median_ < 4) {
+  if (median_ < kMMC) {
     return;
   }
 
-  auto slopes = FindSlopes(kCQ);
-  if (slopes.empty()) {
+  std::int32_t w = WindowLength(kSWL);
+  if (!IsCandidate(median, kCQ, w)) {
     return;
   }
+  chimeric_regions_ = FindRegions(median, kCQ, w, FindMaxima(w));
+
+  if (!chimeric_regions_.empty()) {
+    is_chimeric_ = true;
+  }
+}
+
+std::vector<bool> Pile::Sweep(
+    std::uint16_t median,
+    const std::vector<Setting>& settings) const {
+  std::vector<bool> dst(settings.size(), false);
+
+  std::vector<std::uint32_t> order(settings.size());
+  for (std::uint32_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [&] (std::uint32_t lhs, std::uint32_t rhs) -> bool {
+        return WindowLength(settings[lhs].window) <
+               WindowLength(settings[rhs].window);
+      });
+
+  Maxima m;
+  std::int32_t last_w = 0;
+  for (const auto& it : order) {
+    std::int32_t w = WindowLength(settings[it].window);
+    if (median_ < settings[it].min_median ||
+        !IsCandidate(median, settings[it].ratio, w)) {
+      continue;
+    }
+    if (w != last_w) {
+      m = FindMaxima(w);
+      last_w = w;
+    }
+    dst[it] = !FindRegions(median, settings[it].ratio, w, m).empty();
+  }
+
+  return dst;
+}
+
+Pile::Maxima Pile::FindMaxima(std::int32_t w) const {
+  std::int32_t data_size = data_.size();
+
+  Maxima dst;
+  dst.left.resize(data_size, 0);
+  dst.right.resize(data_size, 0);
+
+  // maximum of (i - w, i - 1]
+  Subpile s;
+  for (std::int32_t i = 1; i < data_size; ++i) {
+    SubpileAdd(s, data_[i - 1], i - 1);
+    SubpileUpdate(s, i - 1 - w);
+    dst.left[i] = s.front().second;
+  }
+
+  // maximum of [i + 1, i + w]
+  s.clear();
+  for (std::int32_t i = data_size - 2; i >= 0; --i) {
+    SubpileAdd(s, data_[i + 1], i + 1);
+    while (s.front().first > i + w) {
+      s.pop_front();
+    }
+    dst.right[i] = s.front().second;
+  }
+
+  return dst;
+}
+
+bool Pile::IsCandidate(std::uint16_t median, double q, std::int32_t w) const {
+  // a chimeric region spans from the start of a down slope to the end of an
+  // up slope and holds a point with coverage below median / q, hence look for
+  // a low point between the first possible down slope and the last possible
+  // up slope, bins are inspected point by point only if the coarse pile
+  // does not rule them out
+  std::int32_t data_size = data_.size();
+  std::int32_t num_bins = coarse_min_.size();
+  if (data_size < 3) {
+    return false;
+  }
+
+  auto bin_begin = [&] (std::int32_t b) -> std::int32_t {
+    return std::max(b << kCPS, 1);
+  };
+  auto bin_end = [&] (std::int32_t b) -> std::int32_t {
+    return std::min((b + 1) << kCPS, data_size - 1);
+  };
+  auto coarse_max = [&] (std::int32_t begin, std::int32_t end) -> std::uint16_t {  // NOLINT
+    std::uint16_t dst = 0;
+    for (std::int32_t i = begin >> kCPS; i <= (end - 1) >> kCPS; ++i) {
+      dst = std::max(dst, coarse_max_[i]);
+    }
+    return dst;
+  };
+  auto max = [&] (std::int32_t begin, std::int32_t end) -> std::uint16_t {
+    std::uint16_t dst = 0;
+    for (std::int32_t i = begin; i < end; ++i) {
+      dst = std::max(dst, data_[i]);
+    }
+    return dst;
+  };
+  auto is_down = [&] (std::int32_t i) -> bool {
+    std::uint16_t d = Clamp(data_[i] * q);
+    return max(std::max(i - w, 0), i) > d;
+  };
+  auto is_up = [&] (std::int32_t i) -> bool {
+    std::uint16_t d = Clamp(data_[i] * q);
+    return max(i + 1, std::min(i + w + 1, data_size)) > d;
+  };
+
+  std::int32_t first_down = -1;
+  for (std::int32_t b = 0; b < num_bins && first_down == -1; ++b) {
+    std::uint16_t d = Clamp(coarse_min_[b] * q);
+    if (coarse_max(std::max((b << kCPS) - w, 0), bin_end(b)) <= d) {
+      continue;
+    }
+    for (std::int32_t i = bin_begin(b); i < bin_end(b); ++i) {
+      if (is_down(i)) {
+        first_down = i;
+        break;
+      }
+    }
+  }
+  if (first_down == -1) {
+    return false;
+  }
+
+  std::int32_t last_up = -1;
+  for (std::int32_t b = num_bins - 1; b >= (first_down >> kCPS) && last_up == -1; --b) {  // NOLINT
+    std::uint16_t d = Clamp(coarse_min_[b] * q);
+    if (coarse_max(bin_begin(b) + 1, std::min(bin_end(b) + w, data_size)) <= d) {  // NOLINT
+      continue;
+    }
+    for (std::int32_t i = bin_end(b) - 1; i >= std::max(bin_begin(b), first_down); --i) {  // NOLINT
+      if (is_up(i)) {
+        last_up = i;
+        break;
+      }
+    }
+  }
+  if (last_up == -1) {
+    return false;
+  }
+
+  for (std::int32_t b = first_down >> kCPS; b <= (last_up >> kCPS); ++b) {
+    if (Clamp(coarse_min_[b] * q) > median) {
+      continue;
+    }
+    for (std::int32_t i = std::max(b << kCPS, first_down);
+         i <= std::min(((b + 1) << kCPS) - 1, last_up); ++i) {
+      if (Clamp(data_[i] * q) <= median) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+std::vector<Pile::Region> Pile::FindRegions(
+    std::uint16_t median,
+    double q,
+    std::int32_t w,
+    const Maxima& m) const {
+  std::vector<Region> dst;
+
+  auto slopes = FindSlopes(q, w, m);
+  if (slopes.empty()) {
+    return dst;
+  }
 
   for (std::uint32_t i = 0; i < slopes.size() - 1; ++i) {
     if (!(slopes[i].first & 1) && (slopes[i + 1].first & 1)) {
-      chimeric_regions_.emplace_back(
+      dst.emplace_back(
           slopes[i].first >> 1,
           slopes[i + 1].second);
     }
   }
-  chimeric_regions_ = MergeRegions(chimeric_regions_);
+  dst = MergeRegions(dst);
 
   auto is_chimeric_region = [&] (const Region& r) -> bool {
     for (std::uint32_t i = r.first; i <= r.second; ++i) {
-      if (Clamp(data_[i] * kCQ) <= median) {
+      if (Clamp(data_[i] * q) <= median) {
         return true;
       }
     }
     return false;
   };
 
-  decltype(chimeric_regions_) dst;
-  for (const auto& it : chimeric_regions_) {
-    if (is_chimeric_region(it)) {
-      dst.emplace_back(it);
-    }
-  }
-  chimeric_regions_.swap(dst);
+  dst.erase(
+      std::remove_if(dst.begin(), dst.end(),
+          [&] (const Region& r) -> bool {
+            return !is_chimeric_region(r);
+          }),
+      dst.end());
 
-  if (!chimeric_regions_.empty()) {
-    is_chimeric_ = true;
-  }
+  return dst;
 }
 
-std::vector<Pile::Region> Pile::FindSlopes(double q) {
-  using Subpile = std::deque<std::pair<std::int32_t, std::uint16_t>>;
-  auto subpile_add = [] (Subpile& s, std::uint16_t value, std::int32_t position) -> void {  // NOLINT
-    while (!s.empty() && s.back().second <= value) {
-      s.pop_back();
-    }
-    s.emplace_back(position, value);
-  };
-  auto subpile_update = [] (Subpile& s, std::int32_t position) {
-    while (!s.empty() && s.front().first <= position) {
-      s.pop_front();
-    }
-  };
-
+std::vector<Pile::Region> Pile::FindSlopes(
+    double q,
+    std::int32_t w,
+    const Maxima& m) const {
   // find slopes
   std::vector<Region> dst;
 
-  std::int32_t w = 847 >> kPSS;
   std::int32_t data_size = data_.size();
 
   Subpile left_subpile;
@@ -120,22 +314,9 @@ std::vector<Pile::Region> Pile::FindSlopes(double q) {
   bool found_up = false;
 
   // find slope regions
-  for (std::int32_t i = 0; i < w; ++i) {
-    subpile_add(right_subpile, data_[i], i);
-  }
   for (std::int32_t i = 0; i < data_size; ++i) {
-    if (i > 0) {
-      subpile_add(left_subpile, data_[i - 1], i - 1);
-    }
-    subpile_update(left_subpile, i - 1 - w);
-
-    if (i < data_size - w) {
-      subpile_add(right_subpile, data_[i + w], i + w);
-    }
-    subpile_update(right_subpile, i);
-
     std::uint16_t d = Clamp(data_[i] * q);
-    if (i != 0 && left_subpile.front().second > d) {
+    if (i != 0 && m.left[i] > d) {
       if (found_down) {
         if (i - last_down > 1) {
           dst.emplace_back(first_down << 1 | 0, last_down);
@@ -147,7 +328,7 @@ std::vector<Pile::Region> Pile::FindSlopes(double q) {
       }
       last_down = i;
     }
-    if (i != (data_size - 1) && right_subpile.front().second > d) {
+    if (i != (data_size - 1) && m.right[i] > d) {
       if (found_up) {
         if (i - last_up > 1) {
           dst.emplace_back(first_up << 1 | 1, last_up);
@@ -187,10 +368,10 @@ std::vector<Pile::Region> Pile::FindSlopes(double q) {
         std::uint32_t subpile_end = std::min(dst[i].second, dst[i + 1].second);
 
         for (std::uint32_t j = subpile_begin; j < subpile_end + 1; ++j) {
-          subpile_add(right_subpile, data_[j], j);
+          SubpileAdd(right_subpile, data_[j], j);
         }
         for (std::uint32_t j = subpile_begin; j < subpile_end; ++j) {
-          subpile_update(right_subpile, j);
+          SubpileUpdate(right_subpile, j);
           if (Clamp(data_[j] * q) < right_subpile.front().second) {
             if (found_up) {
               if (j - last_up > 1) {
@@ -235,7 +416,7 @@ std::vector<Pile::Region> Pile::FindSlopes(double q) {
             }
             last_down = j;
           }
-          subpile_add(left_subpile, data_[j], j);
+          SubpileAdd(left_subpile, data_[j], j);
         }
         if (found_down) {
           dst.emplace_back(first_down << 1, last_down);
@@ -289,7 +470,7 @@ std::vector<Pile::Region> Pile::FindSlopes(double q) {
   return dst;
 }
 
-std::vector<Pile::Region> Pile::MergeRegions(const std::vector<Pile::Region>& src) {  // NOLINT
+std::vector<Pile::Region> Pile::MergeRegions(const std::vector<Pile::Region>& src) const {  // NOLINT
   std::vector<Region> dst;
   std::vector<bool> is_merged(src.size(), 0);
   for (std::uint32_t i = 0; i < src.size(); ++i) {
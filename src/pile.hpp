@@ -13,6 +13,13 @@ namespace merlion {
 
 class Pile {
  public:
+  // parameters of chimeric annotation
+  struct Setting {
+    double ratio;              // coverage ratio which defines a slope
+    std::uint32_t window;      // slope window length in bases
+    std::uint16_t min_median;  // piles with lower median are skipped
+  };
+
   explicit Pile(const Stack& s);
 
   Pile(const Pile&) = default;
@@ -35,20 +42,53 @@ class Pile {
     return is_chimeric_;
   }
 
+  // coverage of each point
+  const std::vector<std::uint16_t>& data() const {
+    return data_;
+  }
+
   void FindMedian();
 
   // store chimeric regions given median coverage
   void FindChimericRegions(std::uint16_t median);
 
+  // annotate with each setting, maxima are shared between equal windows
+  std::vector<bool> Sweep(
+      std::uint16_t median,
+      const std::vector<Setting>& settings) const;
+
  private:
   using Region = std::pair<std::uint32_t, std::uint32_t>;
 
-  std::vector<Region> FindSlopes(double q);
+  // sliding window maxima left and right of each point
+  struct Maxima {
+    std::vector<std::uint16_t> left;
+    std::vector<std::uint16_t> right;
+  };
+
+  Maxima FindMaxima(std::int32_t w) const;
+
+  // conservative screen on the coarse pile, refined point by point where
+  // needed, never rejects a pile the full analysis would flag
+  bool IsCandidate(std::uint16_t median, double q, std::int32_t w) const;
+
+  std::vector<Region> FindRegions(
+      std::uint16_t median,
+      double q,
+      std::int32_t w,
+      const Maxima& m) const;
+
+  std::vector<Region> FindSlopes(
+      double q,
+      std::int32_t w,
+      const Maxima& m) const;
 
-  std::vector<Region> MergeRegions(const std::vector<Region>& r);
+  std::vector<Region> MergeRegions(const std::vector<Region>& r) const;
 
   std::uint32_t id_;
   std::vector<std::uint16_t> data_;
+  std::vector<std::uint16_t> coarse_min_;  // without end points
+  std::vector<std::uint16_t> coarse_max_;
   std::uint16_t median_;
   bool is_chimeric_;
   std::vector<Region> chimeric_regions_;
@@ -1,11 +1,47 @@
 // Copyright (c) 2021 Robert Vaser
 
 #include <algorithm>
+#include <array>
 
 #include "stack.hpp"
 
 namespace merlion {
 
+constexpr std::size_t kISL = 32;  // insertion sort limit
+
+constexpr std::size_t kRSL = 1024;  // radix sort lower limit
+
+// least significant digit radix sort, skips bytes shared by all keys
+void RadixSort(std::vector<std::uint64_t>* keys) {
+  std::vector<std::array<std::uint32_t, 256>> counts(8);
+  for (auto& it : counts) {
+    it.fill(0);
+  }
+  for (const auto& it : *keys) {
+    for (std::uint32_t i = 0; i < 8; ++i) {
+      ++counts[i][(it >> (i << 3)) & 0xFF];
+    }
+  }
+
+  std::vector<std::uint64_t> tmp(keys->size());
+  for (std::uint32_t i = 0; i < 8; ++i) {
+    auto shift = i << 3;
+    if (counts[i][(keys->front() >> shift) & 0xFF] == keys->size()) {
+      continue;
+    }
+    std::uint32_t offset = 0;
+    for (auto& it : counts[i]) {
+      auto c = it;
+      it = offset;
+      offset += c;
+    }
+    for (const auto& it : *keys) {
+      tmp[counts[i][(it >> shift) & 0xFF]++] = it;
+    }
+    keys->swap(tmp);
+  }
+}
+
 Stack::Stack(const biosoup::NucleicAcid& na)
     : id_(na.id),
       len_(na.inflated_len),
@@ -31,7 +67,29 @@ void Stack::AddLayers(
 }
 
 void Stack::SortLayers() {
-  std::sort(layers_.begin(), layers_.end());
+  if (layers_.size() <= kISL) {
+    for (std::size_t i = 1; i < layers_.size(); ++i) {
+      auto layer = layers_[i];
+      std::size_t j = i;
+      for (; j > 0 && layer < layers_[j - 1]; --j) {
+        layers_[j] = layers_[j - 1];
+      }
+      layers_[j] = layer;
+    }
+  } else if (layers_.size() < kRSL) {
+    std::sort(layers_.begin(), layers_.end());
+  } else {
+    std::vector<std::uint64_t> keys;
+    keys.reserve(layers_.size());
+    for (const auto& it : layers_) {
+      keys.emplace_back(static_cast<std::uint64_t>(it.first) << 32 | it.second);  // NOLINT
+    }
+    RadixSort(&keys);
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      layers_[i].first = keys[i] >> 32;
+      layers_[i].second = keys[i] & 0xFFFFFFFF;
+    }
+  }
 }
 
 }  // namespace merlion